@@ -5,6 +5,7 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/schematron.h>
+#include <libxml/xmlschemas.h>
 
 // #  pragma message("USING LIBXLST")
 #include <libxslt/xslt.h>
@@ -18,11 +19,10 @@
 #include <filesystem>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <set>
 #include <stdexcept>
 
-// That's really shitty but it's a global that's needed
-extern int xmlLoadExtDtdDefaultValue;
-
 namespace openstudio {
 
 inline const xmlChar* xml_string(const std::string& s) {
@@ -102,6 +102,42 @@ std::string build_message(const std::string& levelName, const xmlError& error) {
   return oss.str();
 }
 
+// One step of the 'schematron-get-full-path' mode of the Schematron skeleton, which is what ends up in the svrl:failed-assert location.
+// The position is only added when there are several siblings with the same local name
+std::string schematronPathStep(const xmlNode* node, int position, bool hasSameNameSiblings) {
+  std::string step;
+  if (node->ns == nullptr) {
+    step = reinterpret_cast<const char*>(node->name);
+  } else {
+    step = fmt::format("*[local-name()='{}' and namespace-uri()='{}']", reinterpret_cast<const char*>(node->name),
+                       reinterpret_cast<const char*>(node->ns->href));
+  }
+  if (hasSameNameSiblings) {
+    step += fmt::format("[{}]", position);
+  }
+  return step;
+}
+
+// Full path of an element, in the same format as FailedAssert::location
+std::string schematronFullPath(const xmlNode* node) {
+  std::string result;
+  for (; (node != nullptr) && (node->type == XML_ELEMENT_NODE); node = node->parent) {
+    int position = 1;
+    bool hasSameNameSiblings = false;
+    for (const xmlNode* sibling = node->prev; sibling != nullptr; sibling = sibling->prev) {
+      if ((sibling->type == XML_ELEMENT_NODE) && (xmlStrcmp(sibling->name, node->name) == 0)) {
+        ++position;
+        hasSameNameSiblings = true;
+      }
+    }
+    for (const xmlNode* sibling = node->next; (sibling != nullptr) && !hasSameNameSiblings; sibling = sibling->next) {
+      hasSameNameSiblings = (sibling->type == XML_ELEMENT_NODE) && (xmlStrcmp(sibling->name, node->name) == 0);
+    }
+    result.insert(0, "/" + schematronPathStep(node, position, hasSameNameSiblings));
+  }
+  return result;
+}
+
 void callback_structured_error(void* userData, xmlError* error) {
   // This shouldn't happen, but better be safe than sorry
   if (!error) {
@@ -136,12 +172,21 @@ void callback_structured_error(void* userData, xmlError* error) {
       levelName = "fatal error";
     }
 
-    validator->registerLogMessage(LogMessage(level, "XMLValidator", build_message(levelName, *error)));
+    // The key ignores the file name and line, so the same error on the same element matches across two documents
+    const auto* node = static_cast<const xmlNode*>(error->node);
+    std::string location = ((node != nullptr) && (node->type == XML_ELEMENT_NODE)) ? schematronFullPath(node) : fmt::format("line {}", error->line);
+    std::string key = fmt::format("{}.{}: {} @ {}", error->domain, error->code, error->message, location);
+
+    validator->registerLogMessage(LogMessage(level, "XMLValidator", build_message(levelName, *error)), std::move(key));
   }
 }
 
-void XMLValidator::registerLogMessage(LogMessage logMessage) {
+void XMLValidator::registerLogMessage(LogMessage logMessage, std::string key) {
+  if (key.empty()) {
+    key = logMessage.logMessage();
+  }
   m_logMessages.push_back(std::move(logMessage));
+  m_logMessageKeys.push_back(std::move(key));
 }
 
 // void xmlStructuredErrorFunc(void * userData, xmlErrorPtr error);
@@ -168,10 +213,34 @@ XMLValidator::XMLValidator(const openstudio::path& xsdPath) : m_xsdPath(std::fil
   } else if (!openstudio::filesystem::is_regular_file(xsdPath)) {
     throw std::runtime_error(openstudio::toString(xsdPath) + "' XSD cannot be opened");
   }
+
+  // Anything that isn't an actual XSD is a Schematron (.sct) or its XSLT conversion
+  if (xsdPath.extension() != ".xsd") {
+    m_schematronPath = m_xsdPath;
+  } else {
+    compileSchema();
+  }
 }
 
 XMLValidator::XMLValidator(const std::string& xsdString) : m_xsdString(xsdString) {}
 
+XMLValidator::XMLValidator(const openstudio::path& xsdPath, const openstudio::path& schematronPath)
+  : m_xsdPath(std::filesystem::absolute(xsdPath)), m_schematronPath(std::filesystem::absolute(schematronPath)) {
+  for (const auto& p : {xsdPath, schematronPath}) {
+    if (!openstudio::filesystem::exists(p)) {
+      throw std::runtime_error(openstudio::toString(p) + "' does not exist");
+    } else if (!openstudio::filesystem::is_regular_file(p)) {
+      throw std::runtime_error(openstudio::toString(p) + "' cannot be opened");
+    }
+  }
+
+  compileSchema();
+}
+
+void XMLValidator::SchemaDeleter::operator()(xmlSchema* schema) const {
+  xmlSchemaFree(schema);
+}
+
 std::optional<openstudio::path> XMLValidator::xsdPath() const {
 
   return m_xsdPath;
@@ -181,6 +250,10 @@ std::optional<std::string> XMLValidator::xsdString() const {
   return m_xsdString;
 }
 
+std::optional<openstudio::path> XMLValidator::schematronPath() const {
+  return m_schematronPath;
+}
+
 std::vector<LogMessage> XMLValidator::errors() const {
   std::vector<LogMessage> result;
   std::copy_if(m_logMessages.cbegin(), m_logMessages.cend(), std::back_inserter(result),
@@ -214,44 +287,55 @@ bool XMLValidator::validate(const openstudio::path& xmlPath) {
     return false;
   }
 
+  reset();
+
+  // Start on the document to validate side: it is parsed only once, and shared by the XSD and the Schematron passes
+  auto filename_str = openstudio::toString(xmlPath);
+  const auto* filename = filename_str.c_str();
+
+  /*parse the file and get the DOM */
+  xmlDoc* doc = xmlReadFile(filename, nullptr, 0);
+  if (doc == nullptr) {
+    registerLogMessage(LogMessage(LogLevel::Fatal, "XMLValidator", fmt::format("Failed to parse '{}'", filename)));
+    return false;
+  }
+
+  xsdValidateDoc(doc);
+
+  if (!m_schematronPath) {
+    xmlFreeDoc(doc);
+    return isValid();
+  }
+
   // static char * schematron = NULL;
   // static xmlSchematronPtr wxschematron = NULL;
-  auto schematron_filename_str = openstudio::toString(m_xsdPath.value());
+  auto schematron_filename_str = openstudio::toString(m_schematronPath.value());
   const auto* schematron_filename = schematron_filename_str.c_str();
   xmlSchematron* schema = nullptr;
-  xmlDoc* doc = nullptr;
 
   // That's the context for the schematron part
   xmlSchematronParserCtxt* parser_ctxt = nullptr;
   parser_ctxt = xmlSchematronNewParserCtxt(schematron_filename);
   // or: parser_ctxt = xmlSchematronNewDocParserCtxt(xmlDoc*)
   if (parser_ctxt == nullptr) {
-    // xmlFreeDoc(xmlDoc*);
+    xmlFreeDoc(doc);
     throw std::runtime_error("Memory error reading schema in xmlSchematronNewParserCtxt");
   }
 
   schema = xmlSchematronParse(parser_ctxt);
   xmlSchematronFreeParserCtxt(parser_ctxt);
 
-  // Start on the document to validate side
-  auto filename_str = openstudio::toString(xmlPath);
-  const auto* filename = filename_str.c_str();
-
-  /*parse the file and get the DOM */
-  doc = xmlReadFile(filename, nullptr, 0);
-
   xmlSchematronValidCtxt* ctxt = nullptr;
-  int flag = XML_SCHEMATRON_OUT_TEXT;
+  // Failed asserts go through callback_structured_error, alongside the XSD diagnostics
+  int flag = XML_SCHEMATRON_OUT_ERROR;
   ctxt = xmlSchematronNewValidCtxt(schema, flag);
   if (ctxt == nullptr) {
-    // xmlFreeDoc(xmlDoc*);
+    xmlFreeDoc(doc);
     throw std::runtime_error("Memory error reading schema in xmlSchematronNewValidCtxt");
   }
 
   xmlSchematronSetValidStructuredErrors(ctxt, callback_structured_error, this);
 
-  // Let's parse the XML document. The parser will cache any grammars encountered.
-
   int ret = xmlSchematronValidateDoc(ctxt, doc);
   if (ret == 0) {
     fmt::print(stderr, "{} validates\n", filename);
@@ -264,13 +348,54 @@ bool XMLValidator::validate(const openstudio::path& xmlPath) {
 
   xmlSchematronFree(schema);
 
-  xmlFreeDoc(doc);     // free document
-  xmlCleanupParser();  // Free globals
+  // Note: no xmlCleanupParser() here, it would free the XSD builtin types that the cached m_schema still points to
+  xmlFreeDoc(doc);  // free document
 
-  return true;
+  return isValid();
+}
+
+void XMLValidator::compileSchema() {
+  auto xsd_filename_str = openstudio::toString(m_xsdPath.value());
+  xmlSchemaParserCtxt* parser_ctxt = xmlSchemaNewParserCtxt(xsd_filename_str.c_str());
+  if (parser_ctxt == nullptr) {
+    throw std::runtime_error("Memory error reading schema in xmlSchemaNewParserCtxt");
+  }
+  xmlSchemaSetParserStructuredErrors(parser_ctxt, callback_structured_error, this);
+  m_schema.reset(xmlSchemaParse(parser_ctxt));
+  xmlSchemaFreeParserCtxt(parser_ctxt);
+
+  if (!m_schema) {
+    std::string message = fmt::format("'{}' XSD cannot be compiled", xsd_filename_str);
+    for (const auto& logMessage : errors()) {
+      message += fmt::format("\n{}", logMessage.logMessage());
+    }
+    throw std::runtime_error(message);
+  }
+
+  // Warnings about the XSD itself aren't about any document, they would otherwise be wiped by the first reset() anyways
+  reset();
+}
+
+bool XMLValidator::xsdValidateDoc(xmlDoc* doc) {
+  // Only a validator constructed with an actual XSD (and not just a Schematron) does the structural validation
+  if (!m_xsdPath || (m_xsdPath == m_schematronPath)) {
+    return true;
+  }
+
+  xmlSchemaValidCtxt* ctxt = xmlSchemaNewValidCtxt(m_schema.get());
+  if (ctxt == nullptr) {
+    throw std::runtime_error("Memory error reading schema in xmlSchemaNewValidCtxt");
+  }
+
+  xmlSchemaSetValidStructuredErrors(ctxt, callback_structured_error, this);
+
+  int ret = xmlSchemaValidateDoc(ctxt, doc);
+  xmlSchemaFreeValidCtxt(ctxt);
+
+  return ret == 0;
 }
 
-std::vector<std::string> processXSLTApplyResult(xmlDoc* res) {
+std::vector<FailedAssert> processXSLTApplyResult(xmlDoc* res) {
 
   xmlXPathContext* xpathCtx = nullptr;
   xmlXPathObject* xpathObj = nullptr;
@@ -295,28 +420,27 @@ std::vector<std::string> processXSLTApplyResult(xmlDoc* res) {
     throw std::runtime_error(fmt::format("Error: unable to evaluate xpath expression '{}'\n", xpathExpr));
   }
 
-  std::vector<std::string> result;
+  std::vector<FailedAssert> result;
 
   if (xmlXPathNodeSetIsEmpty(xpathObj->nodesetval)) {
     fmt::print("No errors\n");
-    return {};
   } else {
 
     xmlNodeSet* nodeset = xpathObj->nodesetval;
     for (int i = 0; i < nodeset->nodeNr; i++) {
-      xmlNode* error_node = nodeset->nodeTab[i];
-      error_node = error_node->xmlChildrenNode;
-      xmlchar_helper error_message(xmlNodeListGetString(res, error_node->xmlChildrenNode, 1));
-
-      result.emplace_back(error_message.get());
-      // while (error_node != nullptr) {
-      //   if ((xmlStrcmp(error_node->name, (const xmlChar*)"text") == 0)) {
-      //     keyword = xmlNodeListGetString(doc, error_node->xmlChildrenNode, 1);
-      //     printf("text: %s\n", keyword);
-      //   }
-
-      //   error_node = error_node->next;
-      // }
+      xmlNode* assert_node = nodeset->nodeTab[i];
+      xmlchar_helper location(xmlGetProp(assert_node, BAD_CAST "location"));
+      xmlchar_helper test(xmlGetProp(assert_node, BAD_CAST "test"));
+
+      // An empty <svrl:text/> is valid SVRL
+      xmlNode* error_node = assert_node->xmlChildrenNode;
+      xmlchar_helper error_message((error_node != nullptr) ? xmlNodeListGetString(res, error_node->xmlChildrenNode, 1) : nullptr);
+
+      FailedAssert failedAssert;
+      failedAssert.message = (error_message.get() != nullptr) ? error_message.get() : "";
+      failedAssert.location = (location.get() != nullptr) ? location.get() : "";
+      failedAssert.test = (test.get() != nullptr) ? test.get() : "";
+      result.push_back(std::move(failedAssert));
     }
   }
 
@@ -327,6 +451,59 @@ std::vector<std::string> processXSLTApplyResult(xmlDoc* res) {
   return result;
 }
 
+// Same paths as schematronFullPath, but for all the elements in a single walk of the tree
+void indexElementLines(const xmlNode* node, const std::string& parentPath, std::map<std::string, long>& index) {
+  std::map<std::string, int> counts;
+  for (const xmlNode* child = node; child != nullptr; child = child->next) {
+    if (child->type == XML_ELEMENT_NODE) {
+      ++counts[reinterpret_cast<const char*>(child->name)];
+    }
+  }
+
+  std::map<std::string, int> positions;
+  for (const xmlNode* child = node; child != nullptr; child = child->next) {
+    if (child->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    std::string name(reinterpret_cast<const char*>(child->name));
+    std::string path = parentPath + "/" + schematronPathStep(child, ++positions[name], counts[name] > 1);
+    index.emplace(path, xmlGetLineNo(child));
+    indexElementLines(child->children, path, index);
+  }
+}
+
+// Builds the location XPath -> line number index of all the elements of doc, in a single walk of the tree.
+// Attribute contexts aren't indexed: the skeleton writes them as a bare '/@name', without their element, which selects nothing
+std::map<std::string, long> buildLocationIndex(xmlDoc* doc) {
+  std::map<std::string, long> index;
+  indexElementLines(xmlDocGetRootElement(doc), "", index);
+  return index;
+}
+
+// Evaluates each location XPath on the validated document to retrieve the line of the context node
+void resolveLocationLines(xmlDoc* doc, std::vector<FailedAssert>& failedAsserts) {
+  xmlXPathContext* xpathCtx = xmlXPathNewContext(doc);
+  if (xpathCtx == nullptr) {
+    throw std::runtime_error("Error: unable to create new XPath context");
+  }
+
+  for (auto& failedAssert : failedAsserts) {
+    if (failedAssert.location.empty()) {
+      continue;
+    }
+    xmlXPathObject* xpathObj = xmlXPathEvalExpression(xml_string(failedAssert.location), xpathCtx);
+    if (xpathObj == nullptr) {
+      continue;
+    }
+    if (!xmlXPathNodeSetIsEmpty(xpathObj->nodesetval)) {
+      failedAssert.line = xmlGetLineNo(xpathObj->nodesetval->nodeTab[0]);
+    }
+    xmlXPathFreeObject(xpathObj);
+  }
+
+  xmlXPathFreeContext(xpathCtx);
+}
+
 std::string dumpXSLTApplyResultToString(xmlDoc* res, xsltStylesheet* style) {
 
   xmlChar* xml_string = nullptr;
@@ -347,54 +524,324 @@ std::string dumpXSLTApplyResultToString(xmlDoc* res, xsltStylesheet* style) {
   return result;
 }
 
-bool XMLValidator::xsltValidate(const openstudio::path& xmlPath) {
+std::string dumpNode(const xmlNode* node) {
+  std::unique_ptr<xmlBuffer, decltype(&xmlBufferFree)> buffer(xmlBufferCreate(), &xmlBufferFree);
+  xmlNodeDump(buffer.get(), node->doc, const_cast<xmlNode*>(node), 0, 0);
+  return reinterpret_cast<const char*>(xmlBufferContent(buffer.get()));
+}
+
+// Structural diff: records the location of the topmost subtrees of variant that differ from base, starting from the document node.
+// It is exact (whitespace, comments and processing instructions included, the internal DTD subset too), so an identical document
+// is guaranteed to validate the same. Only the XML declaration (version, encoding, standalone) is not compared
+bool sameNodeHeader(const xmlNode* base, const xmlNode* variant) {
+  if (base->type != variant->type) {
+    return false;
+  }
+
+  // The document is not laid out like an xmlNode past the common fields, its name and content can't be compared as such.
+  // Its header is the internal DTD subset, which xsltApplyStylesheet unlinks from the children (but keeps as intSubset)
+  if (base->type == XML_DOCUMENT_NODE) {
+    const xmlDtd* base_dtd = reinterpret_cast<const xmlDoc*>(base)->intSubset;
+    const xmlDtd* variant_dtd = reinterpret_cast<const xmlDoc*>(variant)->intSubset;
+    if ((base_dtd == nullptr) || (variant_dtd == nullptr)) {
+      return base_dtd == variant_dtd;
+    }
+    return dumpNode(reinterpret_cast<const xmlNode*>(base_dtd)) == dumpNode(reinterpret_cast<const xmlNode*>(variant_dtd));
+  }
+
+  if (xmlStrcmp(base->name, variant->name) != 0) {
+    return false;
+  }
+
+  if (base->type != XML_ELEMENT_NODE) {
+    return xmlStrcmp(base->content, variant->content) == 0;
+  }
+
+  const xmlChar* base_ns = (base->ns != nullptr) ? base->ns->href : nullptr;
+  const xmlChar* variant_ns = (variant->ns != nullptr) ? variant->ns->href : nullptr;
+  if (xmlStrcmp(base_ns, variant_ns) != 0) {
+    return false;
+  }
+
+  const xmlAttr* base_attr = base->properties;
+  const xmlAttr* variant_attr = variant->properties;
+  for (; (base_attr != nullptr) && (variant_attr != nullptr); base_attr = base_attr->next, variant_attr = variant_attr->next) {
+    const xmlChar* base_attr_ns = (base_attr->ns != nullptr) ? base_attr->ns->href : nullptr;
+    const xmlChar* variant_attr_ns = (variant_attr->ns != nullptr) ? variant_attr->ns->href : nullptr;
+    if ((xmlStrcmp(base_attr->name, variant_attr->name) != 0) || (xmlStrcmp(base_attr_ns, variant_attr_ns) != 0)) {
+      return false;
+    }
+    xmlchar_helper base_value(xmlNodeListGetString(base->doc, base_attr->children, 1));
+    xmlchar_helper variant_value(xmlNodeListGetString(variant->doc, variant_attr->children, 1));
+    if (xmlStrcmp(BAD_CAST base_value.get(), BAD_CAST variant_value.get()) != 0) {
+      return false;
+    }
+  }
+
+  return (base_attr == nullptr) && (variant_attr == nullptr);
+}
+
+// The DTD node is compared as the document's header, whether or not it is still linked among its children
+std::vector<const xmlNode*> childNodes(const xmlNode* node) {
+  std::vector<const xmlNode*> result;
+  for (const xmlNode* child = node->children; child != nullptr; child = child->next) {
+    if (child->type != XML_DTD_NODE) {
+      result.push_back(child);
+    }
+  }
+  return result;
+}
+
+void diffNodes(const xmlNode* base, const xmlNode* variant, std::vector<std::string>& changedPaths) {
+  // The document node itself has no path
+  auto markChanged = [&changedPaths, variant]() {
+    std::string path = schematronFullPath(variant);
+    changedPaths.push_back(path.empty() ? "/" : path);
+  };
+
+  if (!sameNodeHeader(base, variant)) {
+    markChanged();
+    return;
+  }
+
+  auto base_children = childNodes(base);
+  auto variant_children = childNodes(variant);
+  if (base_children.size() != variant_children.size()) {
+    markChanged();
+    return;
+  }
+
+  // A modified text, comment or processing instruction means its parent (element or document) changed
+  for (std::size_t i = 0; i < base_children.size(); ++i) {
+    if (((base_children[i]->type != XML_ELEMENT_NODE) || (variant_children[i]->type != XML_ELEMENT_NODE))
+        && !sameNodeHeader(base_children[i], variant_children[i])) {
+      markChanged();
+      return;
+    }
+  }
+
+  for (std::size_t i = 0; i < base_children.size(); ++i) {
+    if (variant_children[i]->type == XML_ELEMENT_NODE) {
+      diffNodes(base_children[i], variant_children[i], changedPaths);
+    }
+  }
+}
+
+// The errors among logMessages, along with their key
+std::vector<std::pair<LogMessage, std::string>> keyedErrors(const std::vector<LogMessage>& logMessages, const std::vector<std::string>& keys) {
+  std::vector<std::pair<LogMessage, std::string>> result;
+  for (std::size_t i = 0; i < logMessages.size(); ++i) {
+    if (logMessages[i].logLevel() > LogLevel::Warn) {
+      result.emplace_back(logMessages[i], keys[i]);
+    }
+  }
+  return result;
+}
+
+// Errors present in lhs but not in rhs, matched on their key (message and location) and honoring duplicates
+std::vector<LogMessage> errorsNotIn(const std::vector<std::pair<LogMessage, std::string>>& lhs,
+                                    const std::vector<std::pair<LogMessage, std::string>>& rhs) {
+  std::multiset<std::string> remaining;
+  for (const auto& [logMessage, key] : rhs) {
+    remaining.insert(key);
+  }
+
+  std::vector<LogMessage> result;
+  for (const auto& [logMessage, key] : lhs) {
+    auto it = remaining.find(key);
+    if (it != remaining.end()) {
+      remaining.erase(it);
+    } else {
+      result.push_back(logMessage);
+    }
+  }
+  return result;
+}
+
+void XMLValidator::StylesheetDeleter::operator()(xsltStylesheet* style) const {
+  xsltFreeStylesheet(style);
+}
+
+void XMLValidator::DocDeleter::operator()(xmlDoc* doc) const {
+  xmlFreeDoc(doc);
+}
+
+xsltStylesheet* XMLValidator::compiledStylesheet() {
+  if (!m_stylesheet) {
+    auto schematron_filename_str = openstudio::toString(m_schematronPath.value());
+    const auto* schematron_filename = schematron_filename_str.c_str();
+    m_stylesheet.reset(xsltParseStylesheetFile((const xmlChar*)schematron_filename));
+    if (!m_stylesheet) {
+      throw std::runtime_error(fmt::format("Error: unable to parse the XSLT stylesheet '{}'", schematron_filename));
+    }
+  }
+
+  return m_stylesheet.get();
+}
+
+xmlDoc* XMLValidator::parseForXSLT(const openstudio::path& xmlPath) {
   if (!openstudio::filesystem::exists(xmlPath)) {
     std::cerr << "Error: '" << toString(xmlPath) << "' does not exist";
-    return false;
+    return nullptr;
   } else if (!openstudio::filesystem::is_regular_file(xmlPath)) {
     std::cerr << "Error: '" << toString(xmlPath) << "' XML cannot be opened";
-    return false;
+    return nullptr;
   }
 
-  reset();
+  auto filename_str = openstudio::toString(xmlPath);
+  const auto* filename = filename_str.c_str();
+  // Substitute entities and load the external DTD like the XSLT processor expects, and keep line numbers (even past 65535) for the failed asserts
+  xmlDoc* doc = xmlReadFile(filename, nullptr, XML_PARSE_NOENT | XML_PARSE_DTDLOAD | XML_PARSE_BIG_LINES);
+  if (doc == nullptr) {
+    registerLogMessage(LogMessage(LogLevel::Fatal, "XMLValidator", fmt::format("Failed to parse '{}'", filename)));
+  }
+  return doc;
+}
+
+void XMLValidator::xsltValidateDoc(xmlDoc* doc) {
+  // The document is parsed only once, and shared by the XSD and the XSLT passes
+  xsdValidateDoc(doc);
+
+  if (!m_schematronPath) {
+    return;
+  }
 
   const char* params[16 + 1];
   int nbparams = 0;
   params[nbparams] = nullptr;
-  xmlSubstituteEntitiesDefault(1);
-  xmlLoadExtDtdDefaultValue = 1;
 
-  auto schematron_filename_str = openstudio::toString(m_xsdPath.value());
-  const auto* schematron_filename = schematron_filename_str.c_str();
-  xsltStylesheet* style = xsltParseStylesheetFile((const xmlChar*)schematron_filename);
-
-  auto filename_str = openstudio::toString(xmlPath);
-  const auto* filename = filename_str.c_str();
-  xmlDoc* doc = xmlParseFile(filename);
-  xmlDoc* res = xsltApplyStylesheet(style, doc, params);
+  xsltStylesheet* style = compiledStylesheet();
+  std::unique_ptr<xmlDoc, DocDeleter> res(xsltApplyStylesheet(style, doc, params));
 
   // Dump result of xlstApply
-  m_fullValidationReport = dumpXSLTApplyResultToString(res, style);
+  m_fullValidationReport = dumpXSLTApplyResultToString(res.get(), style);
   fmt::print("\n====== Full Validation Report =====\n\n{}", m_fullValidationReport);
   // xsltSaveResultToFile(stdout, res, style);
 
-  auto m_errors = processXSLTApplyResult(res);
-  for (const auto& error : m_errors) {
-    fmt::print(stderr, "{}\n", error);
-    m_logMessages.emplace_back(LogLevel::Error, "processXSLTApplyResult", error);
-  }
+  m_failedAsserts = processXSLTApplyResult(res.get());
+  registerFailedAsserts(doc);
 
   /* dump the resulting document */
   // xmlDocDump(stdout, res);
+}
 
-  xsltFreeStylesheet(style);
-  xmlFreeDoc(res);
-  xmlFreeDoc(doc);
+void XMLValidator::registerFailedAsserts(xmlDoc* doc) {
+  if (m_failedAsserts.empty()) {
+    return;
+  }
+
+  // Lines always come from doc itself: a document identical to the base can still be shifted by its prolog
+  if (m_useLocationIndex) {
+    auto index = buildLocationIndex(doc);
+    for (auto& failedAssert : m_failedAsserts) {
+      auto it = index.find(failedAssert.location);
+      failedAssert.line = (it != index.end()) ? it->second : 0;
+    }
+  } else {
+    resolveLocationLines(doc, m_failedAsserts);
+  }
 
-  xsltCleanupGlobals();
-  xmlCleanupParser();
+  for (const auto& failedAssert : m_failedAsserts) {
+    fmt::print(stderr, "{}\n", failedAssert.message);
+    registerLogMessage(LogMessage(LogLevel::Error, "processXSLTApplyResult", failedAssert.message),
+                       fmt::format("{} @ {}", failedAssert.message, failedAssert.location));
+  }
+}
+
+bool XMLValidator::xsltValidate(const openstudio::path& xmlPath) {
+  reset();
+
+  std::unique_ptr<xmlDoc, DocDeleter> doc(parseForXSLT(xmlPath));
+  if (!doc) {
+    return false;
+  }
+
+  xsltValidateDoc(doc.get());
+
+  // Note: no xmlCleanupParser() nor xsltCleanupGlobals() here, the cached m_schema and m_stylesheet still point to their globals
+  return isValid();
+}
+
+bool XMLValidator::xsltValidateBase(const openstudio::path& xmlPath) {
+  reset();
+  m_baseDoc.reset();
+  m_baseLogMessages.clear();
+  m_baseLogMessageKeys.clear();
+  m_baseFullValidationReport.clear();
+  m_baseFailedAsserts.clear();
+
+  std::unique_ptr<xmlDoc, DocDeleter> doc(parseForXSLT(xmlPath));
+  if (!doc) {
+    return false;
+  }
+
+  xsltValidateDoc(doc.get());
+
+  // Keep the parsed tree around to diff the variants against it
+  m_baseDoc = std::move(doc);
+  m_baseLogMessages = m_logMessages;
+  m_baseLogMessageKeys = m_logMessageKeys;
+  m_baseFullValidationReport = m_fullValidationReport;
+  m_baseFailedAsserts = m_failedAsserts;
+
+  return isValid();
+}
+
+bool XMLValidator::xsltValidateVariant(const openstudio::path& xmlPath) {
+  if (!m_baseDoc) {
+    throw std::runtime_error("Error: xsltValidateBase must be called before xsltValidateVariant");
+  }
+
+  reset();
+
+  std::unique_ptr<xmlDoc, DocDeleter> doc(parseForXSLT(xmlPath));
+  if (!doc) {
+    // Nothing to diff: the whole document is considered changed, and the errors are still compared to the base
+    m_changedPaths.emplace_back("/");
+  } else {
+    // From the document node, so that the DOCTYPE and the comments and processing instructions around the root element are compared
+    diffNodes(reinterpret_cast<const xmlNode*>(m_baseDoc.get()), reinterpret_cast<const xmlNode*>(doc.get()), m_changedPaths);
+
+    if (m_changedPaths.empty()) {
+      // Identical to the base: the same asserts fail, no need to apply the stylesheet again.
+      // The XSD messages and the assert lines are still about this document (file name, prolog)
+      xsdValidateDoc(doc.get());
+      if (m_schematronPath) {
+        m_fullValidationReport = m_baseFullValidationReport;
+        m_failedAsserts = m_baseFailedAsserts;
+        registerFailedAsserts(doc.get());
+      }
+    } else {
+      xsltValidateDoc(doc.get());
+    }
+  }
+
+  auto baseErrors = keyedErrors(m_baseLogMessages, m_baseLogMessageKeys);
+  auto variantErrors = keyedErrors(m_logMessages, m_logMessageKeys);
+  m_addedErrors = errorsNotIn(variantErrors, baseErrors);
+  m_fixedErrors = errorsNotIn(baseErrors, variantErrors);
+
+  return doc && isValid();
+}
+
+std::vector<FailedAssert> XMLValidator::failedAsserts() const {
+  return m_failedAsserts;
+}
+
+void XMLValidator::setUseLocationIndex(bool useLocationIndex) {
+  m_useLocationIndex = useLocationIndex;
+}
+
+std::vector<LogMessage> XMLValidator::addedErrors() const {
+  return m_addedErrors;
+}
+
+std::vector<LogMessage> XMLValidator::fixedErrors() const {
+  return m_fixedErrors;
+}
 
-  return m_errors.empty();
+std::vector<std::string> XMLValidator::changedPaths() const {
+  return m_changedPaths;
 }
 
 bool XMLValidator::validate(const std::string& /*xmlString*/) {
@@ -403,6 +850,11 @@ bool XMLValidator::validate(const std::string& /*xmlString*/) {
 
 void XMLValidator::reset() {
   m_logMessages.clear();
+  m_logMessageKeys.clear();
+  m_addedErrors.clear();
+  m_fixedErrors.clear();
+  m_changedPaths.clear();
+  m_failedAsserts.clear();
 }
 
 }  // namespace openstudio
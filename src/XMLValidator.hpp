@@ -2,6 +2,7 @@
 #define XMLVALIDATOR_HPP
 
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -10,8 +11,26 @@
 #include "LogMessage.hpp"
 
 typedef struct _xmlError xmlError;
+typedef struct _xmlDoc xmlDoc;
+typedef struct _xmlSchema xmlSchema;
+typedef struct _xsltStylesheet xsltStylesheet;
 
 namespace openstudio {
+
+/// A failed Schematron assertion, as reported in the svrl output of the XSLT validation
+struct FailedAssert
+{
+  /// The assertion message
+  std::string message;
+  /// The full XPath of the rule context node, eg "/*[local-name()='HPXML' and namespace-uri()='...']/*[local-name()='Building' ...]"
+  std::string location;
+  /// The XPath test that failed
+  std::string test;
+  /// The line of the context node in the validated document, 0 if it could not be resolved. That is always the case for an attribute
+  /// context, since the Schematron skeleton reports its location as a bare "/@name" without its parent element
+  long line = 0;
+};
+
 class XMLValidator
 {
  public:
@@ -23,6 +42,9 @@ class XMLValidator
 
   explicit XMLValidator(const std::string& xsdString);
 
+  /// Constructor for a validator that checks the structure against an XSD, then runs the Schematron (.sct or .xslt) on the same parsed document
+  XMLValidator(const openstudio::path& xsdPath, const openstudio::path& schematronPath);
+
   XMLValidator(XMLValidator const& other) = delete;
   XMLValidator& operator=(XMLValidator const& other) = delete;
 
@@ -43,6 +65,8 @@ class XMLValidator
 
   std::optional<std::string> xsdString() const;
 
+  std::optional<openstudio::path> schematronPath() const;
+
   std::vector<LogMessage> errors() const;
 
   std::vector<LogMessage> warnings() const;
@@ -51,6 +75,20 @@ class XMLValidator
 
   std::string fullValidationReport() const;
 
+  /// Failed assertions of the last XSLT validation, with their location and line in the validated document
+  std::vector<FailedAssert> failedAsserts() const;
+
+  /// Errors of the last xsltValidateVariant that the base document did not have (matched on message and location)
+  std::vector<LogMessage> addedErrors() const;
+
+  /// Errors of the base document that the last xsltValidateVariant no longer has
+  std::vector<LogMessage> fixedErrors() const;
+
+  /// XPath of the topmost subtrees where the last xsltValidateVariant document differs from the base document,
+  /// in the same format as FailedAssert::location, eg "/*[local-name()='HPXML' and namespace-uri()='...']/*[local-name()='Building' ...]"
+  /// or "/" when the variant could not be parsed or differs outside of the root element (DOCTYPE, top-level comments...)
+  std::vector<std::string> changedPaths() const;
+
   //@}
   /** @name Setters */
   //@{
@@ -61,6 +99,18 @@ class XMLValidator
 
   bool xsltValidate(const openstudio::path& xmlPath);
 
+  /// Resolve the failedAsserts lines with an index of all element locations built in one pass over the document,
+  /// instead of evaluating each location XPath. Faster when a lot of assertions fail
+  void setUseLocationIndex(bool useLocationIndex);
+
+  /// Validates a base document and keeps it (and its results) as the reference for xsltValidateVariant
+  bool xsltValidateBase(const openstudio::path& xmlPath);
+
+  /// Validates a variant of the base document. Applying the stylesheet is skipped when it is identical to the base
+  /// (whitespace, comments, processing instructions and internal DTD subset included, only the XML declaration is ignored),
+  /// otherwise the whole variant is validated
+  bool xsltValidateVariant(const openstudio::path& xmlPath);
+
   //@}
   /** @name callbacks */
   //@{
@@ -70,19 +120,70 @@ class XMLValidator
  protected:
   void setParser();
   friend void callback_structured_error(void* userData, xmlError* error);
-  void registerLogMessage(LogMessage logMessage);
+  void registerLogMessage(LogMessage logMessage, std::string key = {});
 
  private:
   // REGISTER_LOGGER("openstudio.XMLValidator");
 
   void reset();
 
+  // Compiles the XSD once at construction, then it is reused for every document. Throws if the XSD is invalid
+  void compileSchema();
+
+  // Runs the XSD structural validation on an already parsed document, returns true if it validates (or if there is no XSD)
+  bool xsdValidateDoc(xmlDoc* doc);
+
+  // Compiles the XSLT stylesheet on first use, then reuses it for every subsequent document
+  xsltStylesheet* compiledStylesheet();
+
+  xmlDoc* parseForXSLT(const openstudio::path& xmlPath);
+
+  // Runs the XSD and XSLT passes on an already parsed document
+  void xsltValidateDoc(xmlDoc* doc);
+
+  // Resolves the lines of m_failedAsserts in doc, and registers them as log messages
+  void registerFailedAsserts(xmlDoc* doc);
+
+  struct SchemaDeleter
+  {
+    void operator()(xmlSchema* schema) const;
+  };
+
+  struct StylesheetDeleter
+  {
+    void operator()(xsltStylesheet* style) const;
+  };
+
+  struct DocDeleter
+  {
+    void operator()(xmlDoc* doc) const;
+  };
+
   std::optional<openstudio::path> m_xsdPath;  // TODO: replace to path
   std::optional<std::string> m_xsdString;
+  std::optional<openstudio::path> m_schematronPath;
+
+  std::unique_ptr<xmlSchema, SchemaDeleter> m_schema;
+  std::unique_ptr<xsltStylesheet, StylesheetDeleter> m_stylesheet;
 
   std::vector<LogMessage> m_logMessages;
+  // What identifies each of m_logMessages across documents (message and location, but no file name), to match base and variant errors
+  std::vector<std::string> m_logMessageKeys;
 
   std::string m_fullValidationReport;
+
+  std::vector<FailedAssert> m_failedAsserts;
+  bool m_useLocationIndex = false;
+
+  std::unique_ptr<xmlDoc, DocDeleter> m_baseDoc;
+  std::vector<LogMessage> m_baseLogMessages;
+  std::vector<std::string> m_baseLogMessageKeys;
+  std::string m_baseFullValidationReport;
+  std::vector<FailedAssert> m_baseFailedAsserts;
+
+  std::vector<LogMessage> m_addedErrors;
+  std::vector<LogMessage> m_fixedErrors;
+  std::vector<std::string> m_changedPaths;
 };
 }  // namespace openstudio
 #endif /* ifndef XMLVALIDATOR_HPP */
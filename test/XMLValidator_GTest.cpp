@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
 #include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
 #include <libxml/xmlversion.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -11,6 +15,36 @@
 
 #include <src/resources.hxx>
 
+// Replaces the n-th occurrence (1-based) of 'from' by 'to'
+struct Replacement
+{
+  std::string from;
+  std::string to;
+  int occurrence = 1;
+};
+
+// Writes a copy of a test file, with replacements applied, to a file in the temp directory that is unique to this run
+static void writeVariant(const openstudio::path& basePath, const std::vector<Replacement>& replacements, openstudio::path& variantPath) {
+  std::ifstream ifs(basePath);
+  std::stringstream buffer;
+  buffer << ifs.rdbuf();
+  std::string content = buffer.str();
+  for (const auto& replacement : replacements) {
+    std::size_t pos = std::string::npos;
+    for (int i = 0; i < replacement.occurrence; ++i) {
+      pos = content.find(replacement.from, (pos == std::string::npos) ? 0 : pos + 1);
+      ASSERT_NE(std::string::npos, pos) << "'" << replacement.from << "' occurrence " << replacement.occurrence << " not found";
+    }
+    content.replace(pos, replacement.from.size(), replacement.to);
+  }
+
+  const auto* testInfo = testing::UnitTest::GetInstance()->current_test_info();
+  variantPath = openstudio::filesystem::temp_directory_path()
+                / fmt::format("{}_{}_{}.xml", testInfo->name(), std::random_device{}(), std::hash<std::string>{}(content));
+  std::ofstream ofs(variantPath);
+  ofs << content;
+}
+
 static void print_element_names(xmlNode* a_node) {
   xmlNode* cur_node = nullptr;
   for (cur_node = a_node; cur_node; cur_node = cur_node->next) {
@@ -45,8 +79,11 @@ TEST(LibXMLTest, XMLValidator) {
   openstudio::filesystem::path schematronPath = testDirPath() / "books.sct";
 
   openstudio::XMLValidator xmlValidator(schematronPath);
-  xmlValidator.validate(xmlPath);
-  EXPECT_EQ(0, xmlValidator.errors().size());
+  EXPECT_FALSE(xmlValidator.validate(xmlPath));
+  // The first book has no id
+  auto errors = xmlValidator.errors();
+  ASSERT_EQ(1, errors.size());
+  EXPECT_NE(std::string::npos, errors[0].logMessage().find("/catalog/book[1] line 3: Attribute id is missing")) << errors[0].logMessage();
   EXPECT_EQ(0, xmlValidator.warnings().size());
 }
 
@@ -56,8 +93,11 @@ TEST(LibXMLTest, XMLValidator_HPXMLvalidator) {
   openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.sct";
 
   openstudio::XMLValidator xmlValidator(schematronPath);
-  xmlValidator.validate(xmlPath);
-  EXPECT_EQ(0, xmlValidator.errors().size());
+  EXPECT_FALSE(xmlValidator.validate(xmlPath));
+  // Same EventType error as the XSLT route on base.xml
+  auto errors = xmlValidator.errors();
+  ASSERT_EQ(1, errors.size());
+  EXPECT_NE(std::string::npos, errors[0].logMessage().find("/HPXML/Building/ProjectStatus line 25: Expected EventType")) << errors[0].logMessage();
   EXPECT_EQ(0, xmlValidator.warnings().size());
 }
 
@@ -89,3 +129,280 @@ TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT) {
   EXPECT_EQ(1, xmlValidator.errors().size());
   EXPECT_EQ(0, xmlValidator.warnings().size());
 }
+
+TEST(LibXMLTest, XMLValidator_XSD) {
+  openstudio::filesystem::path xmlPath = testDirPath() / "books.xml";
+  openstudio::filesystem::path xsdPath = testDirPath() / "books.xsd";
+
+  openstudio::XMLValidator xmlValidator(xsdPath);
+  EXPECT_FALSE(xmlValidator.schematronPath());
+  EXPECT_FALSE(xmlValidator.validate(xmlPath));
+
+  // The first book is missing its required id attribute
+  auto errors = xmlValidator.errors();
+  ASSERT_EQ(1, errors.size());
+  EXPECT_NE(std::string::npos, errors[0].logMessage().find("'id' is required")) << errors[0].logMessage();
+  EXPECT_EQ(0, xmlValidator.warnings().size());
+
+  // The compiled XSD is cached and reused
+  EXPECT_FALSE(xmlValidator.validate(xmlPath));
+  EXPECT_EQ(1, xmlValidator.errors().size());
+}
+
+TEST(LibXMLTest, XMLValidator_XSD_and_Schematron) {
+  openstudio::filesystem::path xmlPath = testDirPath() / "base.xml";
+  openstudio::filesystem::path xsdPath = testDirPath() / "HPXML_small.xsd";
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+
+  openstudio::XMLValidator xmlValidator(xsdPath, schematronPath);
+  ASSERT_TRUE(xmlValidator.xsdPath());
+  EXPECT_EQ(std::filesystem::absolute(xsdPath), xmlValidator.xsdPath().value());
+  ASSERT_TRUE(xmlValidator.schematronPath());
+  EXPECT_EQ(std::filesystem::absolute(schematronPath), xmlValidator.schematronPath().value());
+  EXPECT_FALSE(xmlValidator.xsltValidate(xmlPath));
+
+  // Both the XSD (schemaVersion) and the Schematron (EventType) diagnostics end up in the same result
+  auto errors = xmlValidator.errors();
+  ASSERT_EQ(2, errors.size());
+  EXPECT_EQ("XMLValidator", errors[0].logChannel());
+  EXPECT_NE(std::string::npos, errors[0].logMessage().find("schemaVersion")) << errors[0].logMessage();
+  EXPECT_EQ("processXSLTApplyResult", errors[1].logChannel());
+  EXPECT_NE(std::string::npos, errors[1].logMessage().find("EventType")) << errors[1].logMessage();
+}
+
+TEST(LibXMLTest, XMLValidator_XSD_and_Schematron_validate) {
+  openstudio::filesystem::path xmlPath = testDirPath() / "books.xml";
+  openstudio::filesystem::path xsdPath = testDirPath() / "books.xsd";
+  openstudio::filesystem::path schematronPath = testDirPath() / "books.sct";
+
+  openstudio::XMLValidator xmlValidator(xsdPath, schematronPath);
+
+  EXPECT_FALSE(xmlValidator.validate(xmlPath));
+
+  // The first book is missing its id, which both the XSD and the Schematron catch on the same parsed document
+  auto errors = xmlValidator.errors();
+  ASSERT_EQ(2, errors.size());
+  EXPECT_NE(std::string::npos, errors[0].logMessage().find("'id' is required")) << errors[0].logMessage();
+  EXPECT_NE(std::string::npos, errors[1].logMessage().find("/catalog/book[1] line 3: Attribute id is missing")) << errors[1].logMessage();
+}
+
+TEST(LibXMLTest, XMLValidator_XSD_Invalid) {
+  // Not an XSD: it is rejected once at construction instead of being re-parsed for every document
+  openstudio::filesystem::path xsdPath = testDirPath() / "books.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "books.sct";
+  EXPECT_THROW(openstudio::XMLValidator(xsdPath, schematronPath), std::runtime_error);
+}
+
+TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT_Variants) {
+  openstudio::filesystem::path basePath = testDirPath() / "base.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+
+  openstudio::XMLValidator xmlValidator(schematronPath);
+  EXPECT_THROW(xmlValidator.xsltValidateVariant(basePath), std::runtime_error);
+
+  EXPECT_FALSE(xmlValidator.xsltValidateBase(basePath));
+  ASSERT_EQ(1, xmlValidator.errors().size());
+  const std::string eventTypeError = xmlValidator.errors()[0].logMessage();
+
+  // Identical document: the base results are reused
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(basePath));
+  EXPECT_TRUE(xmlValidator.changedPaths().empty());
+  EXPECT_EQ(1, xmlValidator.errors().size());
+  EXPECT_TRUE(xmlValidator.addedErrors().empty());
+  EXPECT_TRUE(xmlValidator.fixedErrors().empty());
+  EXPECT_NE("", xmlValidator.fullValidationReport());
+
+  // Fixing the EventType
+  openstudio::path fixedPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"THIS IS WRONG", "audit"}}, fixedPath));
+  EXPECT_TRUE(xmlValidator.xsltValidateVariant(fixedPath));
+  ASSERT_EQ(1, xmlValidator.changedPaths().size());
+  EXPECT_NE(std::string::npos, xmlValidator.changedPaths()[0].find("'EventType'")) << xmlValidator.changedPaths()[0];
+  EXPECT_EQ(0, xmlValidator.errors().size());
+  EXPECT_TRUE(xmlValidator.addedErrors().empty());
+  ASSERT_EQ(1, xmlValidator.fixedErrors().size());
+  EXPECT_EQ(eventTypeError, xmlValidator.fixedErrors()[0].logMessage());
+
+  // Breaking the Transaction, on top of the existing EventType error
+  openstudio::path brokenPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"<Transaction>create</Transaction>", "<Transaction>delete</Transaction>"}}, brokenPath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(brokenPath));
+  ASSERT_EQ(1, xmlValidator.changedPaths().size());
+  EXPECT_NE(std::string::npos, xmlValidator.changedPaths()[0].find("'Transaction'")) << xmlValidator.changedPaths()[0];
+  EXPECT_EQ(2, xmlValidator.errors().size());
+  ASSERT_EQ(1, xmlValidator.addedErrors().size());
+  EXPECT_NE(std::string::npos, xmlValidator.addedErrors()[0].logMessage().find("Transaction"));
+  EXPECT_TRUE(xmlValidator.fixedErrors().empty());
+
+  // Whitespace only changes (eg a minLength or string-length()) and comments are not identical
+  openstudio::path whitespacePath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"THIS IS WRONG</EventType>", "THIS IS WRONG </EventType>"}}, whitespacePath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(whitespacePath));
+  EXPECT_EQ(1, xmlValidator.changedPaths().size());
+  openstudio::path commentPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"<ProjectStatus>", "<ProjectStatus><!-- a comment -->"}}, commentPath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(commentPath));
+  EXPECT_EQ(1, xmlValidator.changedPaths().size());
+
+  // Neither are changes outside of the root element
+  openstudio::path topLevelCommentPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"?>", "?><!-- a comment -->"}}, topLevelCommentPath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(topLevelCommentPath));
+  EXPECT_EQ(std::vector<std::string>{"/"}, xmlValidator.changedPaths());
+  openstudio::path doctypePath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"?>", "?><!DOCTYPE HPXML [<!ENTITY unused 'text'>]>"}}, doctypePath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(doctypePath));
+  EXPECT_EQ(std::vector<std::string>{"/"}, xmlValidator.changedPaths());
+  EXPECT_TRUE(xmlValidator.addedErrors().empty());
+  EXPECT_TRUE(xmlValidator.fixedErrors().empty());
+
+  // Nor are changes to the internal DTD subset alone
+  openstudio::path otherDoctypePath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(doctypePath, {{"'text'", "'other text'"}}, otherDoctypePath));
+  EXPECT_FALSE(xmlValidator.xsltValidateBase(doctypePath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(doctypePath));
+  EXPECT_TRUE(xmlValidator.changedPaths().empty());
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(otherDoctypePath));
+  EXPECT_EQ(std::vector<std::string>{"/"}, xmlValidator.changedPaths());
+
+  openstudio::filesystem::remove(fixedPath);
+  openstudio::filesystem::remove(brokenPath);
+  openstudio::filesystem::remove(whitespacePath);
+  openstudio::filesystem::remove(commentPath);
+  openstudio::filesystem::remove(topLevelCommentPath);
+  openstudio::filesystem::remove(doctypePath);
+  openstudio::filesystem::remove(otherDoctypePath);
+}
+
+TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT_Variants_ParseFailure) {
+  openstudio::filesystem::path basePath = testDirPath() / "base.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+
+  openstudio::path malformedPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"</HPXML>", "<unclosed></HPXML>"}}, malformedPath));
+
+  openstudio::XMLValidator xmlValidator(schematronPath);
+  EXPECT_FALSE(xmlValidator.xsltValidateBase(basePath));
+  ASSERT_EQ(1, xmlValidator.errors().size());
+  const std::string eventTypeError = xmlValidator.errors()[0].logMessage();
+
+  // The whole document is considered changed, and the errors are still compared to the base
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(malformedPath));
+  EXPECT_EQ(std::vector<std::string>{"/"}, xmlValidator.changedPaths());
+  ASSERT_EQ(1, xmlValidator.addedErrors().size());
+  EXPECT_EQ(LogLevel::Fatal, xmlValidator.addedErrors()[0].logLevel());
+  EXPECT_NE(std::string::npos, xmlValidator.addedErrors()[0].logMessage().find("Failed to parse"));
+  ASSERT_EQ(1, xmlValidator.fixedErrors().size());
+  EXPECT_EQ(eventTypeError, xmlValidator.fixedErrors()[0].logMessage());
+
+  openstudio::filesystem::remove(malformedPath);
+}
+
+TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT_Variants_SameMessage) {
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+  const std::string siding = "<Siding>wood siding</Siding>";
+  const std::string badSiding = "<Siding>bad siding</Siding>";
+
+  // The first Siding is on a RimJoist, the second and third on Wall[1] and Wall[2]
+  openstudio::path basePath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(testDirPath() / "base.xml", {{siding, badSiding, 2}}, basePath));
+  openstudio::path variantPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(testDirPath() / "base.xml", {{siding, badSiding, 3}}, variantPath));
+
+  openstudio::XMLValidator xmlValidator(schematronPath);
+  EXPECT_FALSE(xmlValidator.xsltValidateBase(basePath));
+  EXPECT_FALSE(xmlValidator.xsltValidateVariant(variantPath));
+  EXPECT_EQ(2, xmlValidator.changedPaths().size());
+
+  // Same message, but Wall[1] was fixed and Wall[2] broken
+  ASSERT_EQ(1, xmlValidator.addedErrors().size());
+  ASSERT_EQ(1, xmlValidator.fixedErrors().size());
+  EXPECT_NE(std::string::npos, xmlValidator.addedErrors()[0].logMessage().find("Expected Siding"));
+  EXPECT_EQ(xmlValidator.addedErrors()[0].logMessage(), xmlValidator.fixedErrors()[0].logMessage());
+
+  openstudio::filesystem::remove(basePath);
+  openstudio::filesystem::remove(variantPath);
+}
+
+TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT_FailedAsserts) {
+  openstudio::filesystem::path xmlPath = testDirPath() / "base.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+
+  const std::string expectedLocation = "/*[local-name()='HPXML' and namespace-uri()='http://hpxmlonline.com/2019/10']"
+                                       "/*[local-name()='Building' and namespace-uri()='http://hpxmlonline.com/2019/10']"
+                                       "/*[local-name()='ProjectStatus' and namespace-uri()='http://hpxmlonline.com/2019/10']";
+
+  for (bool useLocationIndex : {false, true}) {
+    openstudio::XMLValidator xmlValidator(schematronPath);
+    xmlValidator.setUseLocationIndex(useLocationIndex);
+    EXPECT_FALSE(xmlValidator.xsltValidate(xmlPath));
+
+    auto failedAsserts = xmlValidator.failedAsserts();
+    ASSERT_EQ(1, failedAsserts.size());
+    EXPECT_EQ(xmlValidator.errors()[0].logMessage(), failedAsserts[0].message);
+    EXPECT_EQ(expectedLocation, failedAsserts[0].location);
+    EXPECT_NE(std::string::npos, failedAsserts[0].test.find("h:EventType")) << failedAsserts[0].test;
+    // The ProjectStatus element
+    EXPECT_EQ(25, failedAsserts[0].line) << "useLocationIndex=" << useLocationIndex;
+  }
+}
+
+TEST(LibXMLTest, XMLValidator_XSLT_FailedAsserts_Attributes) {
+  openstudio::filesystem::path xmlPath = testDirPath() / "books.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "books_iso.xslt";
+
+  for (bool useLocationIndex : {false, true}) {
+    openstudio::XMLValidator xmlValidator(schematronPath);
+    xmlValidator.setUseLocationIndex(useLocationIndex);
+    EXPECT_FALSE(xmlValidator.xsltValidate(xmlPath));
+
+    // The price rule has an empty message, which is valid SVRL
+    auto failedAsserts = xmlValidator.failedAsserts();
+    ASSERT_EQ(5, failedAsserts.size());
+    std::vector<long> idLines;
+    std::vector<long> priceLines;
+    for (const auto& failedAssert : failedAsserts) {
+      if (failedAssert.message.empty()) {
+        priceLines.push_back(failedAssert.line);
+      } else {
+        EXPECT_EQ("Expected id to start with 'bk10'", failedAssert.message);
+        EXPECT_EQ("/@id", failedAssert.location);
+        idLines.push_back(failedAssert.line);
+      }
+    }
+    // The skeleton doesn't say which element an attribute context belongs to, so it can't be resolved in either mode
+    EXPECT_EQ(std::vector<long>({0, 0, 0}), idLines) << "useLocationIndex=" << useLocationIndex;
+    EXPECT_EQ(std::vector<long>({3, 109}), priceLines) << "useLocationIndex=" << useLocationIndex;
+  }
+}
+
+TEST(LibXMLTest, XMLValidator_HPXMLvalidator_XSLT_Variants_LineShift) {
+  openstudio::filesystem::path basePath = testDirPath() / "base.xml";
+  openstudio::filesystem::path schematronPath = testDirPath() / "HPXMLvalidator.xslt";
+
+  // Identical from the root element down, but everything is 5 lines lower
+  openstudio::path shiftedPath;
+  ASSERT_NO_FATAL_FAILURE(writeVariant(basePath, {{"?>", "?>\n\n\n\n\n"}}, shiftedPath));
+
+  for (bool useLocationIndex : {false, true}) {
+    openstudio::XMLValidator xmlValidator(schematronPath);
+    xmlValidator.setUseLocationIndex(useLocationIndex);
+    EXPECT_FALSE(xmlValidator.xsltValidateBase(basePath));
+    ASSERT_EQ(1, xmlValidator.failedAsserts().size());
+    EXPECT_EQ(25, xmlValidator.failedAsserts()[0].line);
+
+    EXPECT_FALSE(xmlValidator.xsltValidateVariant(shiftedPath));
+    EXPECT_TRUE(xmlValidator.changedPaths().empty());
+    ASSERT_EQ(1, xmlValidator.failedAsserts().size());
+    EXPECT_EQ(30, xmlValidator.failedAsserts()[0].line) << "useLocationIndex=" << useLocationIndex;
+    EXPECT_TRUE(xmlValidator.addedErrors().empty());
+    EXPECT_TRUE(xmlValidator.fixedErrors().empty());
+
+    // Same as a fresh validation of that document
+    EXPECT_FALSE(xmlValidator.xsltValidate(shiftedPath));
+    ASSERT_EQ(1, xmlValidator.failedAsserts().size());
+    EXPECT_EQ(30, xmlValidator.failedAsserts()[0].line);
+  }
+
+  openstudio::filesystem::remove(shiftedPath);
+}